@@ -1,9 +1,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#define PROBE_BLOCK_SIZE 4096
+#define PROBE_ERROR_OPEN -1
+#define PROBE_ERROR_SIZE -2
+#define PROBE_ERROR_TABLE -3
+#define MAX_CODE_LENGTH 56
+#define DECODE_FAST_BITS 10
+#define DECODE_CACHE_SIZE 16
+#define MAX_PAYLOAD (16 * 1024 * 1024)
+#define BLOCK_HEADER_SIZE 5
+#define BLOCK_MAX_HEADER_SIZE (BLOCK_HEADER_SIZE + 8)
+#define BLOCK_HUFFMAN 0
+#define BLOCK_LZ77 1
+#define BLOCK_METHOD_MASK 0x0f
+#define BLOCK_CHECK_RAW 0x10
+#define BLOCK_CHECK_PACKED 0x20
+#define BLOCK_CHECK_MASK (BLOCK_CHECK_RAW | BLOCK_CHECK_PACKED)
+#define BLOCK_CHECK_COPY_SHIFT 2
+#define CRC32C_POLY 0x82f63b78u
+#define CRC_STRIDE 1024
+#define CRC_CHUNK_SIZE 4096
+#define MAX_TREE_DEPTH 255
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 258
+#define LZ_HASH_BITS 15
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MIN_WINDOW_BITS 10
+#define LZ_MAX_WINDOW_BITS 20
+#define LZ_LAZY_LEVEL 4
+#define LZ_MATCH_FLAG 0x80000000u
+#define LZ_LITERALS 256
+#define LZ_LENGTH_CODES 16
+#define LZ_DISTANCE_CODES 40
+#define LITLEN_SYMBOLS (LZ_LITERALS + LZ_LENGTH_CODES)
+#define MAX_SYMBOLS LITLEN_SYMBOLS
+#define DEFAULT_LEVEL 6
+#define DEFAULT_WINDOW_BITS 16
+#define FILE_BLOCK_SIZE (1024 * 1024)
+#define MAX_FRAME (MAX_PAYLOAD + 1024)
+#define MAX_CLIENTS 1024
 
 struct Node {
     char data;
+    int symbol;         // alphabet index, which may exceed the range of data
     int freq;
     struct Node* left;
     struct Node* right;
@@ -15,9 +72,21 @@ struct MinHeap {
     struct Node** array;
 };
 
+// Sizes are those of option 4 at level 0 without checksums.
+struct ProbeResult {
+    long inputSize;         // bytes in the input file
+    long sampledBytes;      // bytes that went into the histogram
+    int distinctSymbols;
+    double entropy;         // Shannon entropy in bits per symbol
+    long huffmanBits;       // code bits for the payload
+    long headerBytes;       // block prefixes, block headers and code length tables
+    long compressedBytes;   // total size of the compressed file
+};
+
 struct Node* newNode(char data, int freq) {
     struct Node* node = (struct Node*) malloc(sizeof(struct Node));
     node->data = data;
+    node->symbol = (unsigned char) data;
     node->freq = freq;
     node->left = NULL;
     node->right = NULL;
@@ -91,27 +160,38 @@ struct Node* extractMin(struct MinHeap* minHeap) {
 
 
 
-struct Node* buildHuffmanTree(char* filename) {
-    // Count the frequency of each character in the input file
-    int freq[256] = {0};
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Error: could not open input file\n");
-        exit(1);
-    }
-    char c;
-    while ((c = fgetc(file)) != EOF) {
-        ++freq[c];
+// Fill freq with the byte histogram of in and return the number of bytes counted.
+// With sampleStep > 1 only one block out of every sampleStep is read.
+long countFrequencies(FILE* in, int freq[256], int sampleStep) {
+    unsigned char buffer[PROBE_BLOCK_SIZE];
+    long counted = 0;
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            ++freq[buffer[i]];
+        }
+        counted += n;
+        if (sampleStep > 1 && fseek(in, (long) (sampleStep - 1) * PROBE_BLOCK_SIZE, SEEK_CUR) != 0) {
+            break;
+        }
     }
-    fclose(file);
+    return counted;
+}
 
-    // Build the Huffman tree
-    struct MinHeap* minHeap = createMinHeap(256);
-    for (int i = 0; i < 256; ++i) {
+struct Node* buildHuffmanTreeFromFrequencies(int freq[], int numSymbols) {
+    struct MinHeap* minHeap = createMinHeap(numSymbols);
+    for (int i = 0; i < numSymbols; ++i) {
         if (freq[i] > 0) {
-            insertMinHeap(minHeap, newNode(i, freq[i]));
+            struct Node* leaf = newNode(i, freq[i]);
+            leaf->symbol = i;
+            insertMinHeap(minHeap, leaf);
         }
     }
+    if (minHeap->size == 0) {
+        free(minHeap->array);
+        free(minHeap);
+        return NULL;
+    }
     while (minHeap->size > 1) {
         struct Node* left = extractMin(minHeap);
         struct Node* right = extractMin(minHeap);
@@ -126,6 +206,21 @@ struct Node* buildHuffmanTree(char* filename) {
     return root;
 }
 
+struct Node* buildHuffmanTree(char* filename) {
+    // Count the frequency of each character in the input file
+    int freq[256] = {0};
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Error: could not open input file\n");
+        exit(1);
+    }
+    countFrequencies(file, freq, 1);
+    fclose(file);
+
+    // Build the Huffman tree
+    return buildHuffmanTreeFromFrequencies(freq, 256);
+}
+
 char* getCodeHelper(struct Node* root, char* code, char data, int index) {
     if (root == NULL) {
         return NULL;
@@ -166,18 +261,30 @@ void writeHuffmanTree(struct Node* root, FILE* out) {
     }
 }
 
-struct Node* readHuffmanTree(FILE* in) {
-    char c = fgetc(in);
+struct Node* readHuffmanTreeHelper(FILE* in, int depth) {
+    int c = fgetc(in);
+    if (c == EOF || depth > MAX_TREE_DEPTH) {
+        return NULL;
+    }
     if (c == '#') {
         struct Node* node = newNode('$', 0);
-        node->left = readHuffmanTree(in);
-        node->right = readHuffmanTree(in);
+        node->left = readHuffmanTreeHelper(in, depth + 1);
+        node->right = node->left != NULL ? readHuffmanTreeHelper(in, depth + 1) : NULL;
+        if (node->right == NULL) {
+            freeTree(node);
+            return NULL;
+        }
         return node;
     } else {
         return newNode(c, 0);
     }
 }
 
+// Returns NULL if the tree is truncated or deeper than any Huffman tree over bytes.
+struct Node* readHuffmanTree(FILE* in) {
+    return readHuffmanTreeHelper(in, 0);
+}
+
 void encodeTextAndWriteToFile(char* filename, struct Node* root, FILE* out) {
     FILE* in = fopen(filename, "r");
     if (in == NULL) {
@@ -192,27 +299,1468 @@ void encodeTextAndWriteToFile(char* filename, struct Node* root, FILE* out) {
     fclose(in);
 }
 
-void decodeFileAndWriteText(FILE* in, struct Node* root, FILE* out) {
+// Returns -1 as soon as the input holds anything but a path through the tree,
+// or if it ends part way through a code.
+int decodeFileAndWriteText(FILE* in, struct Node* root, FILE* out) {
     struct Node* current = root;
-    char c;
+    int c;
     while ((c = fgetc(in)) != EOF) {
         if (c == '0') {
             current = current->left;
-        } else {
+        } else if (c == '1') {
             current = current->right;
+        } else {
+            return -1;
+        }
+        if (current == NULL) {
+            return -1;
         }
         if (isLeaf(current)) {
             fputc(current->data, out);
             current = root;
         }
     }
+    // Input that stops part way through a code is truncated
+    return current == root ? 0 : -1;
+}
+
+// CRC32C (Castagnoli). SSE4.2 and PCLMUL are used when the CPU has them: three
+// streams of CRC_STRIDE bytes run through the crc32 instruction side by side
+// and are merged with a carry-less multiply. Otherwise a slicing-by-8 table
+// is used. crc32cInit must run before the first call.
+
+static uint32_t crc32cTable[8][256];
+static int crc32cReady;
+static int crc32cHardware;                  // 1 with the crc32 instruction, 2 with PCLMUL as well
+static uint32_t crc32cStrideShift[2];       // x^(8 * CRC_STRIDE * k - 33) mod P, k = 1, 2
+
+// Product of two bit-reflected polynomials modulo the CRC32C polynomial.
+uint32_t multiplyModP(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^n modulo the CRC32C polynomial, bit-reflected.
+uint32_t xPowModP(uint64_t n) {
+    uint32_t result = 1u << 31;
+    uint32_t square = 1u << 30;
+    while (n != 0) {
+        if (n & 1) {
+            result = multiplyModP(result, square);
+        }
+        square = multiplyModP(square, square);
+        n >>= 1;
+    }
+    return result;
+}
+
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* p, size_t size) {
+    while (size >= 8) {
+        crc ^= (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+        crc = crc32cTable[7][crc & 0xff] ^ crc32cTable[6][(crc >> 8) & 0xff] ^
+              crc32cTable[5][(crc >> 16) & 0xff] ^ crc32cTable[4][crc >> 24] ^
+              crc32cTable[3][p[4]] ^ crc32cTable[2][p[5]] ^ crc32cTable[1][p[6]] ^ crc32cTable[0][p[7]];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32cShiftHardware(uint32_t crc, uint32_t shift) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int) crc), _mm_cvtsi32_si128((int) shift), 0);
+    return (uint32_t) _mm_crc32_u64(0, (uint64_t) _mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32cHardwareUpdate(uint32_t crc, const unsigned char* p, size_t size) {
+    uint64_t word;
+    while (size > 0 && ((uintptr_t) p & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        --size;
+    }
+    if (crc32cHardware >= 2) {
+        while (size >= 3 * CRC_STRIDE) {
+            uint64_t a = crc;
+            uint64_t b = 0;
+            uint64_t c = 0;
+            for (size_t i = 0; i < CRC_STRIDE; i += 8) {
+                memcpy(&word, p + i, 8);
+                a = _mm_crc32_u64(a, word);
+                memcpy(&word, p + CRC_STRIDE + i, 8);
+                b = _mm_crc32_u64(b, word);
+                memcpy(&word, p + 2 * CRC_STRIDE + i, 8);
+                c = _mm_crc32_u64(c, word);
+            }
+            crc = crc32cShiftHardware((uint32_t) a, crc32cStrideShift[1]) ^
+                  crc32cShiftHardware((uint32_t) b, crc32cStrideShift[0]) ^ (uint32_t) c;
+            p += 3 * CRC_STRIDE;
+            size -= 3 * CRC_STRIDE;
+        }
+    }
+    while (size >= 8) {
+        memcpy(&word, p, 8);
+        crc = (uint32_t) _mm_crc32_u64(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+#endif
+
+void crc32cInit() {
+    if (crc32cReady) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32cTable[0][i] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+        for (int i = 0; i < 256; ++i) {
+            uint32_t crc = crc32cTable[k - 1][i];
+            crc32cTable[k][i] = (crc >> 8) ^ crc32cTable[0][crc & 0xff];
+        }
+    }
+    crc32cStrideShift[0] = xPowModP(8 * CRC_STRIDE - 33);
+    crc32cStrideShift[1] = xPowModP(16 * CRC_STRIDE - 33);
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32cHardware = __builtin_cpu_supports("pclmul") ? 2 : 1;
+    }
+#endif
+    crc32cReady = 1;
+}
+
+uint32_t crc32c(uint32_t crc, const unsigned char* data, size_t size) {
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if (crc32cHardware) {
+        return ~crc32cHardwareUpdate(crc, data, size);
+    }
+#endif
+    return ~crc32cSoftware(crc, data, size);
+}
+
+// In-memory codec: canonical Huffman codes packed eight bits per byte, with an
+// optional LZ77 stage in front. A compressed block is laid out as
+//   [1 byte method and check flags][4 bytes original length, big-endian]
+//   [checksums][code length tables][code bits, MSB first]
+// Method BLOCK_HUFFMAN has a single 256-symbol table for bytes. Method BLOCK_LZ77
+// has a literal/length table followed by a distance table; lengths and
+// distances are coded as a bucket symbol followed by raw extra bits.
+// Each code length table stores one byte per symbol, and a zero length is
+// followed by a byte counting the run of zero lengths it starts.
+// BLOCK_CHECK_RAW adds the CRC32C of the original bytes and BLOCK_CHECK_PACKED
+// the CRC32C of the whole block with its own field zeroed, each as 4
+// big-endian bytes in that order. The check flags are repeated in the top two
+// bits of the first byte, so a flipped flag cannot silently turn a check off.
+
+struct Buffer {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+};
+
+struct DecodeTable {
+    int numSymbols;
+    unsigned char lengths[MAX_SYMBOLS];
+    unsigned short fast[1 << DECODE_FAST_BITS];   // symbol << 4 | length, 0 when the code is longer
+    int count[MAX_CODE_LENGTH + 1];
+    unsigned short symbols[MAX_SYMBOLS];          // sorted by code length, then symbol
+};
+
+// Coding state reused from one block or request to the next: the file API's
+// block buffer, the decode table cache and the LZ77 match finder arrays.
+struct CodecContext {
+    struct Buffer output;
+    struct DecodeTable tables[DECODE_CACHE_SIZE];
+    int tableValid[DECODE_CACHE_SIZE];
+    int* head;                  // LZ77 hash heads, LZ_HASH_SIZE entries
+    int* prev;                  // LZ77 hash chains, one window of entries
+    int prevSize;
+    uint32_t* tokens;
+    size_t tokenCapacity;
+};
+
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    uint64_t bits;
+    int count;
+};
+
+struct BitWriter {
+    unsigned char* dst;
+    uint64_t pending;
+    int count;
+};
+
+void freeCodecContext(struct CodecContext* context) {
+    free(context->output.data);
+    free(context->head);
+    free(context->prev);
+    free(context->tokens);
+    free(context);
+}
+
+struct CodecContext* newCodecContext() {
+    crc32cInit();
+    return (struct CodecContext*) calloc(1, sizeof(struct CodecContext));
+}
+
+int bufferReserve(struct Buffer* buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) {
+        return 0;
+    }
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
+    }
+    unsigned char* data = (unsigned char*) realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+void assignCodeLengths(struct Node* root, int depth, unsigned char lengths[], int* tooLong) {
+    if (root == NULL) {
+        return;
+    }
+    if (isLeaf(root)) {
+        // A lone symbol still needs one bit per occurrence
+        int length = depth > 0 ? depth : 1;
+        if (length > MAX_CODE_LENGTH) {
+            *tooLong = 1;
+        }
+        lengths[root->symbol] = length;
+        return;
+    }
+    assignCodeLengths(root->left, depth + 1, lengths, tooLong);
+    assignCodeLengths(root->right, depth + 1, lengths, tooLong);
+}
+
+int buildCodeLengths(int freq[], int numSymbols, unsigned char lengths[]) {
+    int tooLong = 0;
+    memset(lengths, 0, numSymbols);
+    struct Node* root = buildHuffmanTreeFromFrequencies(freq, numSymbols);
+    assignCodeLengths(root, 0, lengths, &tooLong);
+    freeTree(root);
+    return tooLong ? -1 : 0;
 }
 
-int main() {
+void assignCanonicalCodes(const unsigned char lengths[], int numSymbols, uint64_t codes[]) {
+    int count[MAX_CODE_LENGTH + 1] = {0};
+    uint64_t next[MAX_CODE_LENGTH + 1];
+    for (int i = 0; i < numSymbols; ++i) {
+        ++count[lengths[i]];
+    }
+    count[0] = 0;
+    uint64_t code = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + count[length - 1]) << 1;
+        next[length] = code;
+    }
+    for (int i = 0; i < numSymbols; ++i) {
+        codes[i] = lengths[i] > 0 ? next[lengths[i]]++ : 0;
+    }
+}
+
+// Returns -1 if the lengths cannot describe a prefix code.
+int buildDecodeTable(struct DecodeTable* table, const unsigned char lengths[], int numSymbols) {
+    uint64_t codes[MAX_SYMBOLS];
+    int offset[MAX_CODE_LENGTH + 2];
+    table->numSymbols = numSymbols;
+    memcpy(table->lengths, lengths, numSymbols);
+    memset(table->count, 0, sizeof(table->count));
+    memset(table->fast, 0, sizeof(table->fast));
+    for (int i = 0; i < numSymbols; ++i) {
+        if (lengths[i] > MAX_CODE_LENGTH) {
+            return -1;
+        }
+        ++table->count[lengths[i]];
+    }
+    table->count[0] = 0;
+
+    // Kraft inequality: more codes of a length than remain free is over-subscribed
+    uint64_t left = 1;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        left <<= 1;
+        if ((uint64_t) table->count[length] > left) {
+            return -1;
+        }
+        left -= table->count[length];
+    }
+
+    offset[1] = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        offset[length + 1] = offset[length] + table->count[length];
+    }
+    for (int i = 0; i < numSymbols; ++i) {
+        if (lengths[i] > 0) {
+            table->symbols[offset[lengths[i]]++] = i;
+        }
+    }
+
+    assignCanonicalCodes(lengths, numSymbols, codes);
+    for (int i = 0; i < numSymbols; ++i) {
+        int length = lengths[i];
+        if (length > 0 && length <= DECODE_FAST_BITS) {
+            int shift = DECODE_FAST_BITS - length;
+            int first = (int) (codes[i] << shift);
+            for (int j = 0; j < (1 << shift); ++j) {
+                table->fast[first + j] = (unsigned short) (i << 4 | length);
+            }
+        }
+    }
+    return 0;
+}
+
+// Look the table up in the context's cache, building it on a miss.
+struct DecodeTable* getDecodeTable(struct CodecContext* context, const unsigned char lengths[], int numSymbols) {
+    uint32_t hash = 2166136261u ^ numSymbols;
+    for (int i = 0; i < numSymbols; ++i) {
+        hash = (hash ^ lengths[i]) * 16777619u;
+    }
+    // Distance tables get their own half of the cache so an LZ77 block's two tables never evict each other
+    int slot = hash % (DECODE_CACHE_SIZE / 2) + (numSymbols == LZ_DISTANCE_CODES ? DECODE_CACHE_SIZE / 2 : 0);
+    struct DecodeTable* table = &context->tables[slot];
+    if (context->tableValid[slot] && table->numSymbols == numSymbols && memcmp(table->lengths, lengths, numSymbols) == 0) {
+        return table;
+    }
+    context->tableValid[slot] = 0;
+    if (buildDecodeTable(table, lengths, numSymbols) != 0) {
+        return NULL;
+    }
+    context->tableValid[slot] = 1;
+    return table;
+}
+
+void writeCodeLengths(const unsigned char lengths[], int numSymbols, struct Buffer* out) {
+    for (int i = 0; i < numSymbols; ) {
+        if (lengths[i] != 0) {
+            out->data[out->size++] = lengths[i++];
+            continue;
+        }
+        int run = 0;
+        while (i < numSymbols && lengths[i] == 0 && run < 255) {
+            ++run;
+            ++i;
+        }
+        out->data[out->size++] = 0;
+        out->data[out->size++] = run;
+    }
+}
+
+// Number of bytes writeCodeLengths emits for lengths.
+long codeLengthsSize(const unsigned char lengths[], int numSymbols) {
+    long size = 0;
+    for (int i = 0; i < numSymbols; ) {
+        if (lengths[i] != 0) {
+            ++size;
+            ++i;
+            continue;
+        }
+        int run = 0;
+        while (i < numSymbols && lengths[i] == 0 && run < 255) {
+            ++run;
+            ++i;
+        }
+        size += 2;
+    }
+    return size;
+}
+
+// Returns the number of bytes consumed, or -1 on a malformed table.
+long readCodeLengths(const unsigned char* in, size_t size, unsigned char lengths[], int numSymbols) {
+    size_t pos = 0;
+    int i = 0;
+    while (i < numSymbols) {
+        if (pos >= size) {
+            return -1;
+        }
+        unsigned char length = in[pos++];
+        if (length != 0) {
+            lengths[i++] = length;
+            continue;
+        }
+        if (pos >= size) {
+            return -1;
+        }
+        int run = in[pos++];
+        if (run == 0 || i + run > numSymbols) {
+            return -1;
+        }
+        memset(lengths + i, 0, run);
+        i += run;
+    }
+    return (long) pos;
+}
+
+// Values 0-3 are their own bucket; above that each power of two is split into
+// two buckets and the low bits are sent as extra bits.
+int valueBucket(uint32_t value, int* extraBits) {
+    if (value < 4) {
+        *extraBits = 0;
+        return value;
+    }
+    int log = 2;
+    while ((value >> (log + 1)) != 0) {
+        ++log;
+    }
+    *extraBits = log - 1;
+    return 2 * log + ((value >> (log - 1)) & 1);
+}
+
+uint32_t bucketBase(int bucket, int* extraBits) {
+    if (bucket < 4) {
+        *extraBits = 0;
+        return bucket;
+    }
+    int log = bucket / 2;
+    *extraBits = log - 1;
+    return (uint32_t) (2 | (bucket & 1)) << (log - 1);
+}
+
+// Flushes whole bytes first, so up to 56 bits can be added per call.
+void putBits(struct BitWriter* writer, uint64_t value, int count) {
+    writer->pending = (writer->pending << count) | value;
+    writer->count += count;
+    while (writer->count >= 8) {
+        writer->count -= 8;
+        *writer->dst++ = (unsigned char) (writer->pending >> writer->count);
+    }
+}
+
+void flushBits(struct BitWriter* writer) {
+    if (writer->count > 0) {
+        *writer->dst++ = (unsigned char) (writer->pending << (8 - writer->count));
+        writer->count = 0;
+    }
+}
+
+void putUint32(unsigned char* dst, uint32_t value) {
+    dst[0] = (unsigned char) (value >> 24);
+    dst[1] = (unsigned char) (value >> 16);
+    dst[2] = (unsigned char) (value >> 8);
+    dst[3] = (unsigned char) value;
+}
+
+uint32_t getUint32(const unsigned char* src) {
+    return (uint32_t) src[0] << 24 | (uint32_t) src[1] << 16 | (uint32_t) src[2] << 8 | src[3];
+}
+
+// Turn the user-facing checksum choice (0 none, 1 uncompressed, 2 compressed,
+// 3 both) into BLOCK_CHECK_* flags.
+int checkFlags(int checks) {
+    return (checks & 1 ? BLOCK_CHECK_RAW : 0) | (checks & 2 ? BLOCK_CHECK_PACKED : 0);
+}
+
+int checksumCount(int checks) {
+    return ((checks & BLOCK_CHECK_RAW) != 0) + ((checks & BLOCK_CHECK_PACKED) != 0);
+}
+
+// The checksums are left as zeros for finishBlock to fill in.
+void writeBlockHeader(int method, int checks, size_t size, struct Buffer* out) {
+    out->data[out->size++] = (unsigned char) (method | checks | checks << BLOCK_CHECK_COPY_SHIFT);
+    putUint32(out->data + out->size, (uint32_t) size);
+    out->size += 4;
+    memset(out->data + out->size, 0, 4 * checksumCount(checks));
+    out->size += 4 * checksumCount(checks);
+}
+
+void finishBlock(struct Buffer* out, size_t start, int checks, uint32_t rawCrc) {
+    unsigned char* field = out->data + start + BLOCK_HEADER_SIZE;
+    if (checks & BLOCK_CHECK_RAW) {
+        putUint32(field, rawCrc);
+        field += 4;
+    }
+    if (checks & BLOCK_CHECK_PACKED) {
+        putUint32(field, crc32c(0, out->data + start, out->size - start));
+    }
+}
+
+int compressHuffmanBlock(const unsigned char* in, size_t size, int checks, struct Buffer* out) {
+    int freq[256] = {0};
+    unsigned char lengths[256];
+    uint64_t codes[256];
+    uint32_t rawCrc = 0;
+    // Checksum each chunk right after counting it, while it is still in cache
+    for (size_t chunk = 0; chunk < size; chunk += CRC_CHUNK_SIZE) {
+        size_t end = size - chunk < CRC_CHUNK_SIZE ? size : chunk + CRC_CHUNK_SIZE;
+        for (size_t i = chunk; i < end; ++i) {
+            ++freq[in[i]];
+        }
+        if (checks & BLOCK_CHECK_RAW) {
+            rawCrc = crc32c(rawCrc, in + chunk, end - chunk);
+        }
+    }
+    if (buildCodeLengths(freq, 256, lengths) != 0) {
+        return -1;
+    }
+    assignCanonicalCodes(lengths, 256, codes);
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 256; ++i) {
+        bits += (uint64_t) freq[i] * lengths[i];
+    }
+    // Worst case for a length table is two bytes per symbol
+    if (bufferReserve(out, BLOCK_MAX_HEADER_SIZE + 2 * 256 + (size_t) ((bits + 7) / 8)) != 0) {
+        return -1;
+    }
+    size_t start = out->size;
+    writeBlockHeader(BLOCK_HUFFMAN, checks, size, out);
+    writeCodeLengths(lengths, 256, out);
+
+    struct BitWriter writer = {out->data + out->size, 0, 0};
+    for (size_t i = 0; i < size; ++i) {
+        putBits(&writer, codes[in[i]], lengths[in[i]]);
+    }
+    flushBits(&writer);
+    out->size = writer.dst - out->data;
+    finishBlock(out, start, checks, rawCrc);
+    return 0;
+}
+
+// Size of the block compressHuffmanBlock would write, worked out from the code lengths alone.
+long huffmanBlockSize(const unsigned char* in, size_t size, int checks) {
+    int freq[256] = {0};
+    unsigned char lengths[256];
+    for (size_t i = 0; i < size; ++i) {
+        ++freq[in[i]];
+    }
+    if (buildCodeLengths(freq, 256, lengths) != 0) {
+        return -1;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 256; ++i) {
+        bits += (uint64_t) freq[i] * lengths[i];
+    }
+    return BLOCK_HEADER_SIZE + 4 * checksumCount(checks) + codeLengthsSize(lengths, 256) + (long) ((bits + 7) / 8);
+}
+
+static uint32_t hash3(const unsigned char* p) {
+    return ((uint32_t) (p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Longest match for in[pos] within the window, following at most maxChain links.
+size_t findMatch(struct CodecContext* context, const unsigned char* in, size_t size, size_t pos,
+                 int windowMask, int maxChain, size_t niceLength, size_t* distance) {
+    size_t bestLength = 0;
+    size_t maxLength = size - pos < LZ_MAX_MATCH ? size - pos : LZ_MAX_MATCH;
+    if (maxLength < LZ_MIN_MATCH) {
+        return 0;
+    }
+    int candidate = context->head[hash3(in + pos)];
+    while (candidate >= 0 && pos - candidate <= (size_t) windowMask && maxChain-- > 0) {
+        const unsigned char* match = in + candidate;
+        if (match[bestLength] == in[pos + bestLength]) {
+            size_t length = 0;
+            while (length < maxLength && match[length] == in[pos + length]) {
+                ++length;
+            }
+            if (length > bestLength) {
+                bestLength = length;
+                *distance = pos - candidate;
+                if (length >= niceLength || length == maxLength) {
+                    break;
+                }
+            }
+        }
+        candidate = context->prev[candidate & windowMask];
+    }
+    return bestLength >= LZ_MIN_MATCH ? bestLength : 0;
+}
+
+void insertHash(struct CodecContext* context, const unsigned char* in, size_t size, size_t pos, int windowMask) {
+    if (pos + LZ_MIN_MATCH <= size) {
+        uint32_t hash = hash3(in + pos);
+        context->prev[pos & windowMask] = context->head[hash];
+        context->head[hash] = (int) pos;
+    }
+}
+
+int compressLz77Block(struct CodecContext* context, const unsigned char* in, size_t size,
+                      int level, int windowBits, int checks, struct Buffer* out) {
+    static const int maxChains[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+    static const int niceLengths[10] = {0, 8, 16, 32, 32, 64, 128, 128, 258, 258};
+    int windowMask = (1 << windowBits) - 1;
+
+    if (context->head == NULL) {
+        context->head = (int*) malloc(LZ_HASH_SIZE * sizeof(int));
+    }
+    if (context->prevSize < (1 << windowBits)) {
+        free(context->prev);
+        context->prev = (int*) malloc(((size_t) 1 << windowBits) * sizeof(int));
+        context->prevSize = context->prev != NULL ? 1 << windowBits : 0;
+    }
+    if (context->tokenCapacity < size) {
+        free(context->tokens);
+        context->tokens = (uint32_t*) malloc(size * sizeof(uint32_t));
+        context->tokenCapacity = context->tokens != NULL ? size : 0;
+    }
+    if (context->head == NULL || context->prev == NULL || context->tokens == NULL) {
+        return -1;
+    }
+    memset(context->head, -1, LZ_HASH_SIZE * sizeof(int));
+
+    // Tokens are literal bytes, or LZ_MATCH_FLAG | (length - 3) << 20 | (distance - 1)
+    size_t tokenCount = 0;
+    size_t pos = 0;
+    size_t checked = 0;
+    uint32_t rawCrc = 0;
+    while (pos < size) {
+        if ((checks & BLOCK_CHECK_RAW) && pos - checked >= CRC_CHUNK_SIZE) {
+            rawCrc = crc32c(rawCrc, in + checked, pos - checked);
+            checked = pos;
+        }
+        size_t distance = 0;
+        size_t length = findMatch(context, in, size, pos, windowMask, maxChains[level], niceLengths[level], &distance);
+        insertHash(context, in, size, pos, windowMask);
+        // Lazy matching: take a literal if the next position starts a longer match
+        if (level >= LZ_LAZY_LEVEL && length > 0 && length < (size_t) niceLengths[level] && pos + 1 < size) {
+            size_t nextDistance = 0;
+            size_t nextLength = findMatch(context, in, size, pos + 1, windowMask, maxChains[level], niceLengths[level], &nextDistance);
+            if (nextLength > length) {
+                context->tokens[tokenCount++] = in[pos++];
+                insertHash(context, in, size, pos, windowMask);
+                length = nextLength;
+                distance = nextDistance;
+            }
+        }
+        if (length == 0) {
+            context->tokens[tokenCount++] = in[pos++];
+            continue;
+        }
+        context->tokens[tokenCount++] = LZ_MATCH_FLAG | (uint32_t) (length - LZ_MIN_MATCH) << 20 | (uint32_t) (distance - 1);
+        for (size_t i = 1; i < length; ++i) {
+            insertHash(context, in, size, pos + i, windowMask);
+        }
+        pos += length;
+    }
+    if (checks & BLOCK_CHECK_RAW) {
+        rawCrc = crc32c(rawCrc, in + checked, size - checked);
+    }
+
+    int litlenFreq[LITLEN_SYMBOLS] = {0};
+    int distanceFreq[LZ_DISTANCE_CODES] = {0};
+    unsigned char litlenLengths[LITLEN_SYMBOLS];
+    unsigned char distanceLengths[LZ_DISTANCE_CODES];
+    uint64_t litlenCodes[LITLEN_SYMBOLS];
+    uint64_t distanceCodes[LZ_DISTANCE_CODES];
+    uint64_t bits = 0;
+    int extraBits;
+    for (size_t i = 0; i < tokenCount; ++i) {
+        uint32_t token = context->tokens[i];
+        if (!(token & LZ_MATCH_FLAG)) {
+            ++litlenFreq[token];
+            continue;
+        }
+        ++litlenFreq[LZ_LITERALS + valueBucket((token >> 20) & 0xff, &extraBits)];
+        bits += extraBits;
+        ++distanceFreq[valueBucket(token & 0xfffff, &extraBits)];
+        bits += extraBits;
+    }
+    if (buildCodeLengths(litlenFreq, LITLEN_SYMBOLS, litlenLengths) != 0 ||
+        buildCodeLengths(distanceFreq, LZ_DISTANCE_CODES, distanceLengths) != 0) {
+        return -1;
+    }
+    assignCanonicalCodes(litlenLengths, LITLEN_SYMBOLS, litlenCodes);
+    assignCanonicalCodes(distanceLengths, LZ_DISTANCE_CODES, distanceCodes);
+    for (int i = 0; i < LITLEN_SYMBOLS; ++i) {
+        bits += (uint64_t) litlenFreq[i] * litlenLengths[i];
+    }
+    for (int i = 0; i < LZ_DISTANCE_CODES; ++i) {
+        bits += (uint64_t) distanceFreq[i] * distanceLengths[i];
+    }
+    if (bufferReserve(out, BLOCK_MAX_HEADER_SIZE + 2 * (LITLEN_SYMBOLS + LZ_DISTANCE_CODES) + (size_t) ((bits + 7) / 8)) != 0) {
+        return -1;
+    }
+    size_t start = out->size;
+    writeBlockHeader(BLOCK_LZ77, checks, size, out);
+    writeCodeLengths(litlenLengths, LITLEN_SYMBOLS, out);
+    writeCodeLengths(distanceLengths, LZ_DISTANCE_CODES, out);
+
+    struct BitWriter writer = {out->data + out->size, 0, 0};
+    for (size_t i = 0; i < tokenCount; ++i) {
+        uint32_t token = context->tokens[i];
+        if (!(token & LZ_MATCH_FLAG)) {
+            putBits(&writer, litlenCodes[token], litlenLengths[token]);
+            continue;
+        }
+        uint32_t value = (token >> 20) & 0xff;
+        int symbol = LZ_LITERALS + valueBucket(value, &extraBits);
+        putBits(&writer, litlenCodes[symbol], litlenLengths[symbol]);
+        putBits(&writer, value & ((1u << extraBits) - 1), extraBits);
+        value = token & 0xfffff;
+        symbol = valueBucket(value, &extraBits);
+        putBits(&writer, distanceCodes[symbol], distanceLengths[symbol]);
+        putBits(&writer, value & ((1u << extraBits) - 1), extraBits);
+    }
+    flushBits(&writer);
+    out->size = writer.dst - out->data;
+    finishBlock(out, start, checks, rawCrc);
+    return 0;
+}
+
+// Level 0 codes bytes with Huffman alone; levels 1-9 add an LZ77 stage with a
+// sliding window of 2^windowBits bytes and progressively longer match searches.
+// checks is any combination of BLOCK_CHECK_RAW and BLOCK_CHECK_PACKED.
+int compressBuffer(struct CodecContext* context, const unsigned char* in, size_t size,
+                   int level, int windowBits, int checks, struct Buffer* out) {
+    if (size > MAX_PAYLOAD || level < 0 || level > 9 || windowBits < LZ_MIN_WINDOW_BITS || windowBits > LZ_MAX_WINDOW_BITS ||
+        (checks & ~BLOCK_CHECK_MASK) != 0) {
+        return -1;
+    }
+    if (level == 0 || size < LZ_MIN_MATCH) {
+        return compressHuffmanBlock(in, size, checks, out);
+    }
+    size_t start = out->size;
+    if (compressLz77Block(context, in, size, level, windowBits, checks, out) != 0) {
+        return -1;
+    }
+    // Input without repeats costs more as LZ77 tokens than as plain Huffman,
+    // which also decodes faster, so LZ77 has to win outright to be kept
+    long huffmanSize = huffmanBlockSize(in, size, checks);
+    if (huffmanSize >= 0 && out->size - start >= (size_t) huffmanSize) {
+        out->size = start;
+        return compressHuffmanBlock(in, size, checks, out);
+    }
+    return 0;
+}
+
+void refillBits(struct BitReader* reader) {
+    while (reader->count <= 56) {
+        uint64_t byte = reader->pos < reader->size ? reader->data[reader->pos] : 0;
+        reader->bits |= byte << (56 - reader->count);
+        ++reader->pos;
+        reader->count += 8;
+    }
+}
+
+uint32_t getBits(struct BitReader* reader, int count) {
+    if (count == 0) {
+        return 0;
+    }
+    refillBits(reader);
+    uint32_t value = (uint32_t) (reader->bits >> (64 - count));
+    reader->bits <<= count;
+    reader->count -= count;
+    return value;
+}
+
+int decodeSymbol(struct BitReader* reader, const struct DecodeTable* table) {
+    refillBits(reader);
+    unsigned short entry = table->fast[reader->bits >> (64 - DECODE_FAST_BITS)];
+    if (entry != 0) {
+        int length = entry & 15;
+        reader->bits <<= length;
+        reader->count -= length;
+        return entry >> 4;
+    }
+    // Codes longer than the fast table are resolved one bit at a time
+    uint64_t code = 0;
+    uint64_t first = 0;
+    int index = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code |= (reader->bits >> (64 - length)) & 1;
+        uint64_t count = table->count[length];
+        if (code - first < count) {
+            reader->bits <<= length;
+            reader->count -= length;
+            return table->symbols[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// When rawCrc is not NULL the output is checksummed as it is produced.
+int decodeLz77(struct BitReader* reader, const struct DecodeTable* litlen, const struct DecodeTable* distances,
+               unsigned char* dst, size_t size, uint32_t* rawCrc) {
+    size_t produced = 0;
+    size_t checked = 0;
+    int extraBits;
+    while (produced < size) {
+        if (rawCrc != NULL && produced - checked >= CRC_CHUNK_SIZE) {
+            *rawCrc = crc32c(*rawCrc, dst + checked, produced - checked);
+            checked = produced;
+        }
+        int symbol = decodeSymbol(reader, litlen);
+        if (symbol < 0) {
+            return -1;
+        }
+        if (symbol < LZ_LITERALS) {
+            dst[produced++] = (unsigned char) symbol;
+            continue;
+        }
+        size_t length = bucketBase(symbol - LZ_LITERALS, &extraBits) + LZ_MIN_MATCH;
+        length += getBits(reader, extraBits);
+        symbol = decodeSymbol(reader, distances);
+        if (symbol < 0) {
+            return -1;
+        }
+        size_t distance = bucketBase(symbol, &extraBits) + 1;
+        distance += getBits(reader, extraBits);
+        if (distance > produced || length > size - produced) {
+            return -1;
+        }
+        unsigned char* to = dst + produced;
+        const unsigned char* from = to - distance;
+        if (distance >= 8) {
+            // Copy eight bytes at a time; the output buffer has slack for the overrun
+            for (size_t i = 0; i < length; i += 8) {
+                memcpy(to + i, from + i, 8);
+            }
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                to[i] = from[i];
+            }
+        }
+        produced += length;
+    }
+    if (rawCrc != NULL) {
+        *rawCrc = crc32c(*rawCrc, dst + checked, size - checked);
+    }
+    return 0;
+}
+
+int decompressBuffer(struct CodecContext* context, const unsigned char* in, size_t size, struct Buffer* out) {
+    unsigned char litlenLengths[LITLEN_SYMBOLS];
+    unsigned char distanceLengths[LZ_DISTANCE_CODES];
+    uint32_t expectedCrc = 0;
+    uint32_t rawCrc = 0;
+    static const unsigned char zeros[4] = {0};
+    if (size < BLOCK_HEADER_SIZE) {
+        return -1;
+    }
+    int checks = in[0] & BLOCK_CHECK_MASK;
+    if (((in[0] >> BLOCK_CHECK_COPY_SHIFT) & BLOCK_CHECK_MASK) != checks || size < BLOCK_HEADER_SIZE + 4 * (size_t) checksumCount(checks)) {
+        return -1;
+    }
+    size_t pos = BLOCK_HEADER_SIZE;
+    if (checks & BLOCK_CHECK_RAW) {
+        expectedCrc = getUint32(in + pos);
+        pos += 4;
+    }
+    // A damaged block is rejected before its header is trusted or any decoding work is spent on it
+    if (checks & BLOCK_CHECK_PACKED) {
+        uint32_t crc = crc32c(0, in, pos);
+        crc = crc32c(crc, zeros, 4);
+        crc = crc32c(crc, in + pos + 4, size - pos - 4);
+        if (getUint32(in + pos) != crc) {
+            return -1;
+        }
+        pos += 4;
+    }
+    int method = in[0] & BLOCK_METHOD_MASK;
+    size_t originalSize = getUint32(in + 1);
+    if (originalSize > MAX_PAYLOAD || (method != BLOCK_HUFFMAN && method != BLOCK_LZ77)) {
+        return -1;
+    }
+    long tableSize = readCodeLengths(in + pos, size - pos, litlenLengths, method == BLOCK_LZ77 ? LITLEN_SYMBOLS : 256);
+    if (tableSize < 0) {
+        return -1;
+    }
+    pos += tableSize;
+    if (method == BLOCK_LZ77) {
+        tableSize = readCodeLengths(in + pos, size - pos, distanceLengths, LZ_DISTANCE_CODES);
+        if (tableSize < 0) {
+            return -1;
+        }
+        pos += tableSize;
+    }
+    if (originalSize == 0) {
+        return pos != size || ((checks & BLOCK_CHECK_RAW) && expectedCrc != 0) ? -1 : 0;
+    }
+    if (bufferReserve(out, originalSize + 8) != 0) {
+        return -1;
+    }
+
+    struct BitReader reader = {in + pos, size - pos, 0, 0, 0};
+    unsigned char* dst = out->data + out->size;
+    if (method == BLOCK_LZ77) {
+        struct DecodeTable* litlen = getDecodeTable(context, litlenLengths, LITLEN_SYMBOLS);
+        struct DecodeTable* distances = getDecodeTable(context, distanceLengths, LZ_DISTANCE_CODES);
+        if (distances == NULL || litlen == NULL ||
+            decodeLz77(&reader, litlen, distances, dst, originalSize, (checks & BLOCK_CHECK_RAW) ? &rawCrc : NULL) != 0) {
+            return -1;
+        }
+    } else {
+        struct DecodeTable* table = getDecodeTable(context, litlenLengths, 256);
+        if (table == NULL) {
+            return -1;
+        }
+        for (size_t chunk = 0; chunk < originalSize; chunk += CRC_CHUNK_SIZE) {
+            size_t end = originalSize - chunk < CRC_CHUNK_SIZE ? originalSize : chunk + CRC_CHUNK_SIZE;
+            for (size_t i = chunk; i < end; ++i) {
+                int symbol = decodeSymbol(&reader, table);
+                if (symbol < 0) {
+                    return -1;
+                }
+                dst[i] = (unsigned char) symbol;
+            }
+            if (checks & BLOCK_CHECK_RAW) {
+                rawCrc = crc32c(rawCrc, dst + chunk, end - chunk);
+            }
+        }
+    }
+    // Bits consumed beyond the end of the input mean the block was truncated,
+    // and more than a byte left over means it was not the block that was written
+    size_t consumed = reader.pos * 8 - reader.count;
+    if (consumed > reader.size * 8 || reader.size * 8 - consumed > 7) {
+        return -1;
+    }
+    if ((checks & BLOCK_CHECK_RAW) && rawCrc != expectedCrc) {
+        return -1;
+    }
+    out->size += originalSize;
+    return 0;
+}
+
+// Compressed files are a sequence of [4 bytes block length, big-endian][block],
+// each block holding up to FILE_BLOCK_SIZE bytes of input.
+// The file API writes outputFilename only after checking its arguments and
+// removes it again if coding fails part way through.
+int compressFile(char* inputFilename, char* outputFilename, int level, int windowBits, int checks) {
+    if (level < 0 || level > 9 || windowBits < LZ_MIN_WINDOW_BITS || windowBits > LZ_MAX_WINDOW_BITS ||
+        (checks & ~BLOCK_CHECK_MASK) != 0) {
+        return -1;
+    }
+    FILE* in = fopen(inputFilename, "rb");
+    FILE* out = in != NULL ? fopen(outputFilename, "wb") : NULL;
+    unsigned char* block = (unsigned char*) malloc(FILE_BLOCK_SIZE);
+    struct CodecContext* context = newCodecContext();
+    int status = in != NULL && out != NULL && block != NULL && context != NULL ? 0 : -1;
+    size_t n;
+    while (status == 0 && (n = fread(block, 1, FILE_BLOCK_SIZE, in)) > 0) {
+        context->output.size = 4;
+        if (bufferReserve(&context->output, 4) != 0 || compressBuffer(context, block, n, level, windowBits, checks, &context->output) != 0) {
+            status = -1;
+            break;
+        }
+        size_t length = context->output.size - 4;
+        context->output.data[0] = (unsigned char) (length >> 24);
+        context->output.data[1] = (unsigned char) (length >> 16);
+        context->output.data[2] = (unsigned char) (length >> 8);
+        context->output.data[3] = (unsigned char) length;
+        if (fwrite(context->output.data, 1, context->output.size, out) != context->output.size) {
+            status = -1;
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0) {
+        status = -1;
+    }
+    if (out != NULL && status != 0) {
+        remove(outputFilename);
+    }
+    if (context != NULL) {
+        freeCodecContext(context);
+    }
+    free(block);
+    return status;
+}
+
+int decompressFile(char* inputFilename, char* outputFilename) {
+    FILE* in = fopen(inputFilename, "rb");
+    FILE* out = in != NULL ? fopen(outputFilename, "wb") : NULL;
+    unsigned char* block = (unsigned char*) malloc(MAX_FRAME);
+    struct CodecContext* context = newCodecContext();
+    int status = in != NULL && out != NULL && block != NULL && context != NULL ? 0 : -1;
+    unsigned char header[4];
+    size_t n;
+    while (status == 0 && (n = fread(header, 1, 4, in)) > 0) {
+        size_t length = (size_t) header[0] << 24 | (size_t) header[1] << 16 | (size_t) header[2] << 8 | header[3];
+        context->output.size = 0;
+        if (n != 4 || length > MAX_FRAME || fread(block, 1, length, in) != length ||
+            decompressBuffer(context, block, length, &context->output) != 0 ||
+            fwrite(context->output.data, 1, context->output.size, out) != context->output.size) {
+            status = -1;
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0) {
+        status = -1;
+    }
+    if (out != NULL && status != 0) {
+        remove(outputFilename);
+    }
+    if (context != NULL) {
+        freeCodecContext(context);
+    }
+    free(block);
+    return status;
+}
+
+// Estimate how well filename compresses without writing any output.
+// The code lengths come from the whole (or sampled) file, so the result is
+// exact for files of one block and an estimate for larger ones, whose blocks
+// each get their own table.
+// Returns 0 on success or one of the PROBE_ERROR_* codes.
+int probeFile(char* filename, int sampleStep, struct ProbeResult* result) {
+    int freq[256] = {0};
+    unsigned char lengths[256];
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return PROBE_ERROR_OPEN;
+    }
+    // ftell gives -1 for pipes and for files too large for a long.
+    if (fseek(file, 0, SEEK_END) != 0 || (result->inputSize = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return PROBE_ERROR_SIZE;
+    }
+    result->sampledBytes = countFrequencies(file, freq, sampleStep);
+    fclose(file);
+
+    result->distinctSymbols = 0;
+    result->entropy = 0.0;
+    for (int i = 0; i < 256; ++i) {
+        if (freq[i] > 0) {
+            double p = (double) freq[i] / result->sampledBytes;
+            result->entropy -= p * log2(p);
+            ++result->distinctSymbols;
+        }
+    }
+
+    if (buildCodeLengths(freq, 256, lengths) != 0) {
+        return PROBE_ERROR_TABLE;
+    }
+    double bits = 0;
+    for (int i = 0; i < 256; ++i) {
+        bits += (double) freq[i] * lengths[i];
+    }
+    if (result->sampledBytes > 0 && result->sampledBytes < result->inputSize) {
+        bits = bits * result->inputSize / result->sampledBytes;
+    }
+    long blocks = (result->inputSize + FILE_BLOCK_SIZE - 1) / FILE_BLOCK_SIZE;
+    result->huffmanBits = (long) bits;
+    result->headerBytes = blocks * (4 + BLOCK_HEADER_SIZE + codeLengthsSize(lengths, 256));
+    result->compressedBytes = result->headerBytes + (result->huffmanBits + 7) / 8;
+    return 0;
+}
+
+const char* probeErrorMessage(int error) {
+    switch (error) {
+    case PROBE_ERROR_OPEN:
+        return "could not open input file";
+    case PROBE_ERROR_SIZE:
+        return "input file is not seekable or is too large to probe";
+    default:
+        return "could not build a code table for the input";
+    }
+}
+
+void printProbeResult(struct ProbeResult* result) {
+    printf("Input size       : %ld bytes\n", result->inputSize);
+    printf("Sampled          : %ld bytes\n", result->sampledBytes);
+    printf("Distinct symbols : %d\n", result->distinctSymbols);
+    printf("Entropy          : %.4f bits/symbol\n", result->entropy);
+    printf("Huffman payload  : %ld bits\n", result->huffmanBits);
+    printf("Header overhead  : %ld bytes\n", result->headerBytes);
+    printf("Compressed size  : %ld bytes\n", result->compressedBytes);
+    if (result->inputSize > 0) {
+        printf("Compressed ratio : %.4f\n", (double) result->compressedBytes / result->inputSize);
+    }
+}
+
+#ifndef _WIN32
+
+// Daemon mode: a poll() loop accepts clients on a Unix domain socket and hands
+// complete frames to a pool of worker threads, each with its own CodecContext.
+// Workers leave the response in the connection's output buffer and the loop
+// writes it without blocking, so a client that stops reading only stalls itself.
+// Request frame:  [1 byte op 'C' or 'D'][4 bytes payload length, big-endian][payload]
+// Response frame: [1 byte status, 0 on success][4 bytes payload length][payload]
+
+struct Connection {
+    int fd;
+    int busy;           // a worker owns the frame at the front of input
+    int failed;
+    int eof;            // the client has shut down its side
+    struct Buffer input;
+    size_t frameSize;
+    struct Buffer output;
+    size_t written;     // bytes of output already sent
+};
+
+struct Job {
+    struct Connection* connection;
+    struct Job* next;
+};
+
+struct Daemon {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct Job* head;
+    struct Job* tail;
+    int notifyPipe[2];
+    int level;
+    int checks;
+};
+
+// Size of the frame at the front of input, or 0 until all of it has arrived.
+size_t bufferedFrameSize(struct Buffer* input) {
+    if (input->size < 5) {
+        return 0;
+    }
+    size_t length = getUint32(input->data + 1);
+    return input->size >= 5 + length ? 5 + length : 0;
+}
+
+int hasPendingOutput(struct Connection* connection) {
+    return connection->written < connection->output.size;
+}
+
+// Sends as much of the response as the socket takes without blocking.
+int flushOutput(struct Connection* connection) {
+    struct Buffer* output = &connection->output;
+    while (connection->written < output->size) {
+        ssize_t n = send(connection->fd, output->data + connection->written, output->size - connection->written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        connection->written += n;
+    }
+    output->size = 0;
+    connection->written = 0;
+    return 0;
+}
+
+// Reads until one complete frame is buffered, never holding more than MAX_FRAME + 5 bytes.
+int readInput(struct Connection* connection) {
+    struct Buffer* input = &connection->input;
+    while (bufferedFrameSize(input) == 0 && input->size < MAX_FRAME + 5) {
+        size_t want = MAX_FRAME + 5 - input->size;
+        if (want > 65536) {
+            want = 65536;
+        }
+        if (bufferReserve(input, want) != 0) {
+            return -1;
+        }
+        ssize_t n = recv(connection->fd, input->data + input->size, want, 0);
+        if (n > 0) {
+            input->size += n;
+        } else if (n == 0) {
+            connection->eof = 1;
+            return 0;
+        } else if (errno != EINTR) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+    }
+    return 0;
+}
+
+void handleFrame(struct CodecContext* context, struct Connection* connection, int level, int checks) {
+    unsigned char op = connection->input.data[0];
+    const unsigned char* payload = connection->input.data + 5;
+    size_t size = connection->frameSize - 5;
+    struct Buffer* out = &connection->output;
+    int status = -1;
+
+    // Reserve room for the response header and fill it in afterwards
+    out->size = 0;
+    if (bufferReserve(out, 5) == 0) {
+        out->size = 5;
+        if (op == 'C') {
+            status = compressBuffer(context, payload, size, level, DEFAULT_WINDOW_BITS, checks, out);
+        } else if (op == 'D') {
+            status = decompressBuffer(context, payload, size, out);
+        }
+    }
+    if (status != 0) {
+        out->size = 5;
+    }
+    size_t length = out->size - 5;
+    out->data[0] = status == 0 ? 0 : 1;
+    out->data[1] = (unsigned char) (length >> 24);
+    out->data[2] = (unsigned char) (length >> 16);
+    out->data[3] = (unsigned char) (length >> 8);
+    out->data[4] = (unsigned char) length;
+}
+
+void* daemonWorker(void* arg) {
+    struct Daemon* daemon = (struct Daemon*) arg;
+    struct CodecContext* context = newCodecContext();
+    if (context == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&daemon->lock);
+        while (daemon->head == NULL) {
+            pthread_cond_wait(&daemon->ready, &daemon->lock);
+        }
+        struct Job* job = daemon->head;
+        daemon->head = job->next;
+        if (daemon->head == NULL) {
+            daemon->tail = NULL;
+        }
+        pthread_mutex_unlock(&daemon->lock);
+
+        handleFrame(context, job->connection, daemon->level, daemon->checks);
+        // Hand the connection and its response back to the event loop. The
+        // connection stays busy until it arrives, so losing it is fatal.
+        ssize_t n;
+        do {
+            n = write(daemon->notifyPipe[1], &job->connection, sizeof(job->connection));
+        } while (n < 0 && errno == EINTR);
+        if (n != (ssize_t) sizeof(job->connection)) {
+            printf("Error: could not return a connection to the event loop\n");
+            exit(1);
+        }
+        free(job);
+    }
+    return NULL;
+}
+
+// If a complete frame is buffered, queue it for the workers.
+// Returns -1 if the client sent something that is not a valid frame.
+int dispatchFrame(struct Daemon* daemon, struct Connection* connection) {
+    struct Buffer* input = &connection->input;
+    if (connection->busy || hasPendingOutput(connection) || input->size < 5) {
+        return 0;
+    }
+    size_t length = getUint32(input->data + 1);
+    if ((input->data[0] != 'C' && input->data[0] != 'D') || length > MAX_FRAME) {
+        return -1;
+    }
+    if (input->size < 5 + length) {
+        return 0;
+    }
+    struct Job* job = (struct Job*) malloc(sizeof(struct Job));
+    if (job == NULL) {
+        return -1;
+    }
+    connection->frameSize = 5 + length;
+    connection->busy = 1;
+    job->connection = connection;
+    job->next = NULL;
+    pthread_mutex_lock(&daemon->lock);
+    if (daemon->tail != NULL) {
+        daemon->tail->next = job;
+    } else {
+        daemon->head = job;
+    }
+    daemon->tail = job;
+    pthread_cond_signal(&daemon->ready);
+    pthread_mutex_unlock(&daemon->lock);
+    return 0;
+}
+
+void closeConnection(struct Connection* connection) {
+    close(connection->fd);
+    free(connection->input.data);
+    free(connection->output.data);
+    free(connection);
+}
+
+int runDaemon(char* socketPath, int workers, int level, int checks) {
+    struct Daemon daemon;
+    struct Connection* connections[MAX_CLIENTS];
+    struct pollfd fds[MAX_CLIENTS + 2];
+    int connectionCount = 0;
+
+    if (level < 0 || level > 9) {
+        printf("Error: level must be between 0 and 9\n");
+        return 1;
+    }
+    if (checks < 0 || checks > 3) {
+        printf("Error: checksums must be between 0 and 3\n");
+        return 1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        printf("Error: socket path is too long\n");
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    memset(&daemon, 0, sizeof(daemon));
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.ready, NULL);
+    daemon.level = level;
+    daemon.checks = checkFlags(checks);
+    if (pipe(daemon.notifyPipe) != 0) {
+        printf("Error: could not create notification pipe\n");
+        return 1;
+    }
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("Error: could not listen on %s\n", socketPath);
+        return 1;
+    }
+    unlink(socketPath);
+    if (bind(listenFd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listenFd, 128) != 0) {
+        printf("Error: could not listen on %s\n", socketPath);
+        close(listenFd);
+        return 1;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    if (workers < 1) {
+        workers = 1;
+    }
+    int started = 0;
+    for (int i = 0; i < workers; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, daemonWorker, &daemon) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        ++started;
+    }
+    if (started == 0) {
+        printf("Error: could not start any worker threads\n");
+        close(listenFd);
+        unlink(socketPath);
+        return 1;
+    }
+    printf("Listening on %s with %d workers at level %d\n", socketPath, started, level);
+    fflush(stdout);
+
+    for (;;) {
+        // Connections with a frame in flight are not polled until the worker returns
+        // them, and no more input is read while a response is waiting to be sent
+        int nfds = 2;
+        fds[0].fd = listenFd;
+        fds[0].events = connectionCount < MAX_CLIENTS ? POLLIN : 0;
+        fds[1].fd = daemon.notifyPipe[0];
+        fds[1].events = POLLIN;
+        for (int i = 0; i < connectionCount; ++i) {
+            struct Connection* connection = connections[i];
+            // A worker owns the buffers of a busy connection, so leave them alone
+            fds[nfds].fd = connection->busy ? -1 : connection->fd;
+            fds[nfds].events = connection->busy ? 0 : hasPendingOutput(connection) ? POLLOUT : connection->eof ? 0 : POLLIN;
+            fds[nfds].revents = 0;
+            ++nfds;
+        }
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error: poll failed\n");
+            return 1;
+        }
+
+        for (int i = 0; i < connectionCount; ++i) {
+            struct Connection* connection = connections[i];
+            if (fds[i + 2].revents == 0) {
+                continue;
+            }
+            int status = hasPendingOutput(connection) ? flushOutput(connection) : readInput(connection);
+            if (status != 0 || dispatchFrame(&daemon, connection) != 0) {
+                connection->failed = 1;
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            struct Connection* done[64];
+            ssize_t n = read(daemon.notifyPipe[0], done, sizeof(done));
+            for (int i = 0; i < n / (ssize_t) sizeof(done[0]); ++i) {
+                struct Connection* connection = done[i];
+                struct Buffer* input = &connection->input;
+                memmove(input->data, input->data + connection->frameSize, input->size - connection->frameSize);
+                input->size -= connection->frameSize;
+                connection->busy = 0;
+                if (flushOutput(connection) != 0 || dispatchFrame(&daemon, connection) != 0) {
+                    connection->failed = 1;
+                }
+            }
+        }
+
+        // A client that has shut down is closed once its last complete frame is answered
+        for (int i = 0; i < connectionCount; ) {
+            struct Connection* connection = connections[i];
+            int finished = !connection->busy && connection->eof && !hasPendingOutput(connection) &&
+                bufferedFrameSize(&connection->input) == 0;
+            if (!connection->busy && (connection->failed || finished)) {
+                closeConnection(connections[i]);
+                connections[i] = connections[--connectionCount];
+            } else {
+                ++i;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while (connectionCount < MAX_CLIENTS && (fd = accept(listenFd, NULL, NULL)) >= 0) {
+                struct Connection* connection = (struct Connection*) calloc(1, sizeof(struct Connection));
+                if (connection == NULL) {
+                    close(fd);
+                    break;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                connection->fd = fd;
+                connections[connectionCount++] = connection;
+            }
+        }
+    }
+    return 0;
+}
+
+#endif
+
+int main(int argc, char** argv) {
     char filename[100];
 
     int n;
-    printf(" Encoding - 1 \n Decoding - 2 \n Enter option : ");
+    crc32cInit();
+    if (argc >= 3 && strcmp(argv[1], "--probe") == 0) {
+        struct ProbeResult result;
+        int error = probeFile(argv[2], argc >= 4 ? atoi(argv[3]) : 1, &result);
+        if (error != 0) {
+            printf("Error: %s\n", probeErrorMessage(error));
+            return 1;
+        }
+        printProbeResult(&result);
+        return 0;
+    }
+#ifndef _WIN32
+    if (argc >= 3 && strcmp(argv[1], "--daemon") == 0) {
+        return runDaemon(argv[2], argc >= 4 ? atoi(argv[3]) : 4, argc >= 5 ? atoi(argv[4]) : DEFAULT_LEVEL,
+                         argc >= 6 ? atoi(argv[5]) : 0);
+    }
+#endif
+    printf(" Encoding - 1 \n Decoding - 2 \n Probe - 3 \n Compress (LZ77 + Huffman) - 4 \n Decompress - 5 \n Enter option : ");
     scanf("%d", &n);
 
     if(n == 1){
@@ -241,18 +1789,117 @@ int main() {
     else if(n == 2){
 
     FILE* treeFile = fopen("tree.txt", "r");
+    if (treeFile == NULL) {
+        printf("Error: could not open tree.txt\n");
+        return 1;
+    }
     struct Node* root = readHuffmanTree(treeFile);
     fclose(treeFile);
+    if (root == NULL) {
+        printf("Error: tree.txt is corrupt\n");
+        return 1;
+    }
 
     // Decode the binary file and write it to a text file
     FILE* inputFile = fopen("encoded.bin", "rb");
+    if (inputFile == NULL) {
+        printf("Error: could not open encoded.bin\n");
+        freeTree(root);
+        return 1;
+    }
     FILE* outputFile = fopen("decoded.txt", "w");
-    decodeFileAndWriteText(inputFile, root, outputFile);
+    int status = decodeFileAndWriteText(inputFile, root, outputFile);
     fclose(inputFile);
     fclose(outputFile);
 
     // Free the memory used by the Huffman tree
     freeTree(root);
+    if (status != 0) {
+        printf("Error: encoded.bin is corrupt\n");
+        return 1;
+    }
+
+    }
+
+    else if(n == 3){
+
+    int sampleStep = 1;
+    printf("Enter the name of the input file: ");
+    if (scanf("%99s", filename) != 1) {
+        printf("Error: no input file given\n");
+        return 1;
+    }
+    printf("Read one block in every N (1 = whole file): ");
+    if (scanf("%d", &sampleStep) != 1) {
+        printf("Error: invalid block step\n");
+        return 1;
+    }
+
+    struct ProbeResult result;
+    int error = probeFile(filename, sampleStep, &result);
+    if (error != 0) {
+        printf("Error: %s\n", probeErrorMessage(error));
+        return 1;
+    }
+    printProbeResult(&result);
+
+    }
+
+    else if(n == 4){
+
+    char outputFilename[100];
+    int level = DEFAULT_LEVEL, windowBits = DEFAULT_WINDOW_BITS, checks = 0;
+    printf("Enter the name of the input file: ");
+    if (scanf("%99s", filename) != 1) {
+        printf("Error: no input file given\n");
+        return 1;
+    }
+    printf("Enter the name of the output file: ");
+    if (scanf("%99s", outputFilename) != 1) {
+        printf("Error: no output file given\n");
+        return 1;
+    }
+    printf("Enter level (0 = Huffman only, 1-9 = LZ77 + Huffman): ");
+    if (scanf("%d", &level) != 1) {
+        printf("Error: invalid level\n");
+        return 1;
+    }
+    printf("Enter window size in bits (%d-%d): ", LZ_MIN_WINDOW_BITS, LZ_MAX_WINDOW_BITS);
+    if (scanf("%d", &windowBits) != 1) {
+        printf("Error: invalid window size\n");
+        return 1;
+    }
+    printf("Enter checksums (0 = none, 1 = uncompressed data, 2 = compressed data, 3 = both): ");
+    if (scanf("%d", &checks) != 1) {
+        printf("Error: invalid checksums\n");
+        return 1;
+    }
+
+    if (checks < 0 || checks > 3 || compressFile(filename, outputFilename, level, windowBits, checkFlags(checks)) != 0) {
+        printf("Error: could not compress the input file\n");
+        return 1;
+    }
+
+    }
+
+    else if(n == 5){
+
+    char outputFilename[100];
+    printf("Enter the name of the input file: ");
+    if (scanf("%99s", filename) != 1) {
+        printf("Error: no input file given\n");
+        return 1;
+    }
+    printf("Enter the name of the output file: ");
+    if (scanf("%99s", outputFilename) != 1) {
+        printf("Error: no output file given\n");
+        return 1;
+    }
+
+    if (decompressFile(filename, outputFilename) != 0) {
+        printf("Error: could not decompress the input file\n");
+        return 1;
+    }
 
     }
 
@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define MAX_TREE_DEPTH 255
+
 struct Node
 {
     char data;
@@ -198,14 +200,23 @@ void writeHuffmanTree(struct Node *root, FILE *out)
     }
 }
 
-struct Node *readHuffmanTree(FILE *in)
+struct Node *readHuffmanTreeHelper(FILE *in, int depth)
 {
-    char c = fgetc(in);
+    int c = fgetc(in);
+    if (c == EOF || depth > MAX_TREE_DEPTH)
+    {
+        return NULL;
+    }
     if (c == '#')
     {
         struct Node *node = newNode('$', 0);
-        node->left = readHuffmanTree(in);
-        node->right = readHuffmanTree(in);
+        node->left = readHuffmanTreeHelper(in, depth + 1);
+        node->right = node->left != NULL ? readHuffmanTreeHelper(in, depth + 1) : NULL;
+        if (node->right == NULL)
+        {
+            freeTree(node);
+            return NULL;
+        }
         return node;
     }
     else
@@ -214,6 +225,12 @@ struct Node *readHuffmanTree(FILE *in)
     }
 }
 
+// Returns NULL if the tree is truncated or deeper than any Huffman tree over bytes.
+struct Node *readHuffmanTree(FILE *in)
+{
+    return readHuffmanTreeHelper(in, 0);
+}
+
 void encodeTextAndWriteToFile(char *filename, struct Node *root, FILE *out)
 {
     FILE *in = fopen(filename, "r");
@@ -231,26 +248,38 @@ void encodeTextAndWriteToFile(char *filename, struct Node *root, FILE *out)
     fclose(in);
 }
 
-void decodeFileAndWriteText(FILE *in, struct Node *root, FILE *out)
+// Returns -1 as soon as the input holds anything but a path through the tree,
+// or if it ends part way through a code.
+int decodeFileAndWriteText(FILE *in, struct Node *root, FILE *out)
 {
     struct Node *current = root;
-    char c;
+    int c;
     while ((c = fgetc(in)) != EOF)
     {
         if (c == '0')
         {
             current = current->left;
         }
-        else
+        else if (c == '1')
         {
             current = current->right;
         }
+        else
+        {
+            return -1;
+        }
+        if (current == NULL)
+        {
+            return -1;
+        }
         if (isLeaf(current))
         {
             fputc(current->data, out);
             current = root;
         }
     }
+    // Input that stops part way through a code is truncated
+    return current == root ? 0 : -1;
 }
 
 char inputFilename[256];
@@ -310,11 +339,21 @@ void decodeFileAndSave()
 
     // Read the Huffman tree from "tree.txt"
     FILE *treeFile = fopen("tree.txt", "r");
-    struct Node *root = readHuffmanTree(treeFile);
-    fclose(treeFile);
+    struct Node *root = treeFile != NULL ? readHuffmanTree(treeFile) : NULL;
+    if (treeFile != NULL)
+    {
+        fclose(treeFile);
+    }
+    if (root == NULL)
+    {
+        MessageBoxA(NULL, "Error: tree.txt is missing or corrupt", "Error", MB_ICONERROR);
+        fclose(inputFile);
+        fclose(outputFile);
+        return;
+    }
 
     // Decode the input binary file and write it to the output text file
-    decodeFileAndWriteText(inputFile, root, outputFile);
+    int status = decodeFileAndWriteText(inputFile, root, outputFile);
 
     // Close files
     fclose(inputFile);
@@ -323,6 +362,12 @@ void decodeFileAndSave()
     // Free the memory used by the Huffman tree
     freeTree(root);
 
+    if (status != 0)
+    {
+        MessageBoxA(NULL, "Error: The input file is corrupt", "Error", MB_ICONERROR);
+        return;
+    }
+
     MessageBoxA(NULL, "File decoded and saved successfully!", "Success", MB_ICONINFORMATION);
 }
 